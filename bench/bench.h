@@ -0,0 +1,119 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    /**
+     * Prevent the compiler from optimizing away a computed value.
+     */
+    template<typename T>
+    inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const T *sink;
+        sink = &value;
+#endif
+    }
+
+    struct options {
+        options()
+            :   points(10000000)
+            ,   repeats(15)
+            ,   csv(false)
+        {}
+
+        // only run benchmarks whose name contains this string.
+        std::string filter;
+        // size of the generated dataset. 10m is the size used by the challenge.
+        size_t points;
+        // each benchmark is run this many times, the median and minimum are reported.
+        int repeats;
+        bool csv;
+    };
+
+    /**
+     * parse --points N, --repeats N, --filter S and --csv. Exits on unknown arguments.
+     */
+    inline options parse_options(int argc, char **argv) {
+        options opt;
+        for(int i = 1; i < argc; i++) {
+            const char *arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (!strcmp(arg, "--points") && has_value) {
+                opt.points = strtoull(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "--repeats") && has_value) {
+                opt.repeats = std::max(1, atoi(argv[++i]));
+            } else if (!strcmp(arg, "--filter") && has_value) {
+                opt.filter = argv[++i];
+            } else if (!strcmp(arg, "--csv")) {
+                opt.csv = true;
+            } else {
+                std::cerr << "usage: " << argv[0] << " [--points N] [--repeats N] [--filter S] [--csv]" << std::endl;
+                exit(1);
+            }
+        }
+        return opt;
+    }
+
+    inline bool enabled(const options &opt, const std::string &name) {
+        return opt.filter.empty() || name.find(opt.filter) != std::string::npos;
+    }
+
+    inline void print_header(const options &opt) {
+        if (opt.csv) {
+            std::cout << "name,ops,median_ns_per_op,min_ns_per_op" << std::endl;
+        } else {
+            std::cout << std::left << std::setw(56) << "benchmark"
+                      << std::right << std::setw(14) << "median ns/op"
+                      << std::setw(14) << "min ns/op" << std::endl;
+        }
+    }
+
+    /**
+     * Time f(), which performs 'ops' operations, opt.repeats times and report the
+     * median and minimum time per operation. f() is run once before timing to warm
+     * the caches.
+     */
+    template<typename F>
+    void run(const options &opt, const std::string &name, size_t ops, F f) {
+        if (!enabled(opt, name) || ops == 0) {
+            return;
+        }
+
+        typedef std::chrono::steady_clock clock;
+        f();
+
+        std::vector<double> samples;
+        samples.reserve(opt.repeats);
+        for(int i = 0; i < opt.repeats; i++) {
+            auto start = clock::now();
+            f();
+            auto stop = clock::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / ops);
+        }
+        std::sort(begin(samples), end(samples));
+
+        double median = samples[samples.size() / 2];
+        double minimum = samples.front();
+        if (opt.csv) {
+            std::cout << name << "," << ops << "," << median << "," << minimum << std::endl;
+        } else {
+            std::cout << std::left << std::setw(56) << name
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(14) << median
+                      << std::setw(14) << minimum << std::endl;
+        }
+    }
+}
+
+#endif // BENCH_H
@@ -0,0 +1,520 @@
+/**
+ * Microbenchmarks for the individual components of the search. Each section
+ * isolates a single kernel so regressions can be tracked per kernel rather than
+ * only end to end.
+ *
+ * usage: churchill_bench [--points N] [--repeats N] [--filter S] [--csv]
+ */
+
+#include "bench.h"
+#include "dataset.h"
+
+#include "solution.h"
+#include "binary_search.h"
+#include "rank_heap.h"
+#include "small_rank_heap.h"
+#include "aligned_allocator.h"
+#include "util.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// mirrors the mipmap schedule in the Solution constructor.
+const point_index LINEAR_COUNT = 1 << 11;
+const point_index FIRST_LEVEL_SIZE = 3050;
+const point_index GROWTH = 3;
+
+struct levels {
+    std::vector<bin_search> x;
+    std::vector<bin_search> y;
+};
+
+levels make_levels(const std::vector<Point> &by_rank)
+{
+    levels result;
+    auto first = begin(by_rank) + std::min((size_t)LINEAR_COUNT, by_rank.size());
+    auto pivot = first;
+    auto last = end(by_rank);
+    point_index size = FIRST_LEVEL_SIZE;
+    while(pivot != last) {
+        pivot = pivot + std::min(size, (point_index)std::distance(pivot, last));
+        result.x.push_back(make_bin_search_from_x(first, pivot));
+        result.y.push_back(make_bin_search_from_y(first, pivot));
+        size = size * GROWTH;
+        first = pivot;
+    }
+    return result;
+}
+
+std::string name(const std::string &a, const std::string &b) {
+    return a + "/" + b;
+}
+
+template<typename T>
+std::string str(T value) {
+    std::ostringstream os;
+    os << value;
+    return os.str();
+}
+
+void bench_search_linear(const bench::options &opt, Solution &solution)
+{
+    // the linear scan stops early for large rects, and scans all points for small ones.
+    struct shape { const char *name; float w, h; };
+    const shape shapes[] = {
+        {"large", 0.5f, 0.5f},
+        {"medium", 0.1f, 0.1f},
+        {"small", 0.01f, 0.01f},
+        {"wide", 1.0f, 0.001f},
+    };
+
+    std::vector<Point> out(20);
+    for(const shape &s : shapes) {
+        auto rects = bench::make_rects(1024, s.w, s.h);
+        bench::run(opt, name("search_linear", s.name), rects.size(), [&]{
+            for(const Rect &r : rects) {
+                bench::do_not_optimize(solution.search_linear(r, 20, out.data()));
+            }
+        });
+    }
+}
+
+template<typename Heap>
+void bench_avx_search_single_bounds(const bench::options &opt, const char *heap_name)
+{
+    const point_index lengths[] = {64, 1024, 16384, 262144};
+    const float selectivities[] = {0.001f, 0.01f, 0.1f, 1.0f};
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for(point_index length : lengths) {
+        std::vector<float, aligned_allocator<float, 64>> floats(length);
+        std::vector<point_index> indices(length);
+        for(point_index i = 0; i < length; i++) {
+            floats[i] = unit(rng);
+            indices[i] = (point_index)(unit(rng) * 10000000);
+        }
+
+        for(float selectivity : selectivities) {
+            Heap heap;
+            const float low = 0.5f * (1.0f - selectivity);
+            const float high = low + selectivity;
+            const int calls = std::max(1, (1 << 20) / length);
+            bench::run(opt, name(name("avx_search_single_bounds", heap_name), str(length) + "/sel" + str(selectivity)), calls, [&]{
+                for(int c = 0; c < calls; c++) {
+                    heap.reset(20);
+                    avx_search_single_bounds(floats.data(), indices.data(), low, high, length, heap);
+                    bench::do_not_optimize(heap.top());
+                }
+            });
+        }
+    }
+}
+
+void bench_bin_search(const bench::options &opt, levels &lv, bench::distribution d)
+{
+    std::mt19937 rng(4);
+    const point_index epsilons[] = {8, 16, 32, 64};
+
+    const size_t n_queries = 4096;
+    for(size_t level = 0; level < lv.x.size(); level++) {
+        bin_search &to = lv.x[level];
+
+        // query values are drawn from the data, so skewed data gets skewed queries.
+        std::uniform_int_distribution<point_index> pick(0, to.size() - 1);
+        std::vector<float> low_values(n_queries), high_values(n_queries);
+        for(size_t q = 0; q < n_queries; q++) {
+            low_values[q] = to.values()[pick(rng)];
+            high_values[q] = low_values[q] + 0.01f;
+        }
+
+        const std::string prefix = name(name("bin_search", bench::distribution_name(d)), "level" + str(level));
+        bench::run(opt, name(prefix, "full"), n_queries, [&]{
+            for(size_t q = 0; q < n_queries; q++) {
+                bench::do_not_optimize(to.lower_bound(low_values[q]));
+                bench::do_not_optimize(to.upper_bound(high_values[q]));
+            }
+        });
+
+        if (level > 0) {
+            const bin_search &from = lv.x[level - 1];
+            auto lower = make_lower_cascading(from, to);
+            auto upper = make_upper_cascading(from, to);
+            std::vector<point_index> low_hint(n_queries), high_hint(n_queries);
+            for(size_t q = 0; q < n_queries; q++) {
+                low_hint[q] = from.lower_bound(low_values[q]);
+                high_hint[q] = from.upper_bound(high_values[q]);
+            }
+
+            bench::run(opt, name(prefix, "cascading"), n_queries, [&]{
+                for(size_t q = 0; q < n_queries; q++) {
+                    point_index l = low_hint[q];
+                    point_index h = high_hint[q];
+                    bench::do_not_optimize(to.lower_bound(low_values[q], lower[l], lower[l + 1]));
+                    bench::do_not_optimize(to.upper_bound(high_values[q], upper[h], upper[h + 1]));
+                }
+            });
+        }
+
+        for(point_index epsilon : epsilons) {
+            to.build_model(epsilon);
+            bench::run(opt, name(prefix, "model" + str(epsilon)), n_queries, [&]{
+                for(size_t q = 0; q < n_queries; q++) {
+                    bench::do_not_optimize(to.model_lower_bound(low_values[q]));
+                    bench::do_not_optimize(to.model_upper_bound(high_values[q]));
+                }
+            });
+        }
+    }
+}
+
+void print_index_memory(const bench::options &opt, const levels &lv, bench::distribution d)
+{
+    if (opt.csv || !bench::enabled(opt, "memory")) {
+        return;
+    }
+
+    // four cascading tables (x/y, lower/upper) against two models (x/y) per level.
+    size_t cascading = 0;
+    size_t model = 0;
+    for(size_t level = 0; level < lv.x.size(); level++) {
+        if (level > 0) {
+            cascading += 4 * (lv.x[level - 1].size() + 2) * sizeof(point_index);
+        }
+        position_model x(lv.x[level].values(), lv.x[level].size(), 16);
+        position_model y(lv.y[level].values(), lv.y[level].size(), 16);
+        model += x.memory_usage() + y.memory_usage();
+    }
+    std::cout << "memory/" << bench::distribution_name(d) << ": cascading " << cascading / 1024
+              << " KiB, model16 " << model / 1024 << " KiB" << std::endl;
+}
+
+/**
+ * Not an benchmark: model_index and cascading_index must return the same points.
+ * The points get the cases the position models are weakest at: an few isolated
+ * far away coordinates and long runs of equal coordinates. Returns the number of
+ * results that differ.
+ */
+size_t check_index(const bench::options &opt, std::vector<Point> points, bench::distribution d)
+{
+    const std::string prefix = name("check/index", bench::distribution_name(d));
+    if (!bench::enabled(opt, prefix)) {
+        return 0;
+    }
+
+    // every 8th point snapped to an 1/64 grid, the last few points far outside [0, 1).
+    const float grid = 64;
+    for(size_t i = 0; i < points.size(); i += 8) {
+        points[i].x = std::floor(points[i].x * grid) / grid;
+        points[i].y = std::floor(points[i].y * grid) / grid;
+    }
+    const float outliers[][2] = {{100, 0.5f}, {-100, 0.5f}, {0.5f, 1e30f}, {0.5f, -1e30f}};
+    for(size_t i = 0; i < 4; i++) {
+        points[points.size() - 1 - i].x = outliers[i][0];
+        points[points.size() - 1 - i].y = outliers[i][1];
+    }
+
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<Rect> unbounded, degenerate, outlier;
+    for(const Rect &r : bench::make_rects(256, 0.1f, 0.1f)) {
+        unbounded.push_back({-inf, r.ly, r.hx, inf});
+        unbounded.push_back({r.lx, -inf, inf, r.hy});
+        unbounded.push_back({-inf, -inf, inf, inf});
+        // on the grid, an single line, an single point and an inverted rect.
+        float gx = std::floor(r.lx * grid) / grid;
+        float gy = std::floor(r.ly * grid) / grid;
+        degenerate.push_back({gx, gy, gx + 1 / grid, gy + 1 / grid});
+        degenerate.push_back({gx, r.ly, gx, r.hy});
+        degenerate.push_back({gx, gy, gx, gy});
+        degenerate.push_back({r.hx, r.hy, r.lx, r.ly});
+    }
+    for(size_t i = 0; i < 4; i++) {
+        float x = outliers[i][0], y = outliers[i][1];
+        outlier.push_back({x, y, x, y});
+        outlier.push_back({std::min(x, 50.0f), -inf, inf, inf});
+        outlier.push_back({-inf, std::min(y, 0.6f), inf, inf});
+        outlier.push_back({-inf, -inf, std::max(x, -50.0f), inf});
+        outlier.push_back({-inf, -inf, inf, std::max(y, 0.4f)});
+    }
+
+    struct shape { const char *name; const std::vector<Rect> *rects; };
+    const shape shapes[] = {
+        {"unbounded", &unbounded},
+        {"degenerate", &degenerate},
+        {"outlier", &outlier},
+    };
+
+    Solution cascading(points.data(), points.data() + points.size(), Solution::cascading_index);
+    Solution model(points.data(), points.data() + points.size(), Solution::model_index);
+    size_t total = 0;
+    for(const shape &s : shapes) {
+        size_t queries = 0, differ = 0;
+        for(point_index count : {20, 100}) {
+            std::vector<Point> expected(count), out(count);
+            for(const Rect &r : *s.rects) {
+                point_index n = cascading.search(r, count, expected.data());
+                point_index m = model.search(r, count, out.data());
+                bool same = n == m;
+                for(point_index i = 0; same && i < n; i++) {
+                    same = expected[i].rank == out[i].rank;
+                }
+                queries++;
+                differ += !same;
+            }
+        }
+        (opt.csv ? std::cerr : std::cout) << name(prefix, s.name) << ": " << differ << " of " << queries
+                                          << " differ between the model and cascading index" << std::endl;
+        total += differ;
+    }
+    return total;
+}
+
+/**
+ * Not an benchmark: every search_with_deadline() result that claims to be exact must
+ * be the same as the result of search(). Returns the number of results that differ.
+ */
+size_t check_deadline(const bench::options &opt, Solution &solution, const std::vector<Rect> &rects,
+                      bench::distribution d, const char *shape)
+{
+    const std::string check_name = name(name("check/deadline", bench::distribution_name(d)), shape);
+    if (!bench::enabled(opt, check_name)) {
+        return 0;
+    }
+
+    size_t queries = 0, exact = 0, differ = 0;
+    std::vector<Point> expected(20), out(20);
+    for(int64_t budget_ns : {0, 2000, 20000}) {
+        for(const Rect &r : rects) {
+            point_index n = solution.search(r, 20, expected.data());
+            search_status status;
+            point_index m = solution.search_with_deadline(r, 20, out.data(), budget_ns, &status);
+            queries++;
+            if (!status.exact) {
+                continue;
+            }
+            exact++;
+            bool same = n == m;
+            for(point_index i = 0; same && i < n; i++) {
+                same = expected[i].rank == out[i].rank;
+            }
+            differ += !same;
+        }
+    }
+    (opt.csv ? std::cerr : std::cout) << check_name << ": " << exact << " of " << queries
+                                      << " exact, " << differ << " differ from search()" << std::endl;
+    return differ;
+}
+
+size_t bench_search(const bench::options &opt, const std::vector<Point> &points, bench::distribution d)
+{
+    if (d == bench::distribution::cross) {
+        auto rects = bench::make_center_rects(256);
+        Solution solution(points.data(), points.data() + points.size());
+        std::vector<Point> out(20);
+        bench::run(opt, "search/cross/model/center", rects.size(), [&]{
+            for(const Rect &r : rects) {
+                bench::do_not_optimize(solution.search(r, 20, out.data()));
+            }
+        });
+        size_t differ = check_deadline(opt, solution, rects, d, "center");
+        // the same queries under an budget, the exact fraction is printed below.
+        for(int64_t budget_us : {20, 100}) {
+            size_t exact = 0;
+            bench::run(opt, "search/cross/model/center/deadline" + str(budget_us) + "us", rects.size(), [&]{
+                exact = 0;
+                for(const Rect &r : rects) {
+                    search_status status;
+                    bench::do_not_optimize(solution.search_with_deadline(r, 20, out.data(), budget_us * 1000, &status));
+                    exact += status.exact;
+                }
+            });
+            if (!opt.csv && bench::enabled(opt, "search/cross/model/center/deadline" + str(budget_us) + "us")) {
+                std::cout << "  exact " << exact << "/" << rects.size() << std::endl;
+            }
+        }
+        return differ;
+    }
+
+    struct shape { const char *name; float w, h; };
+    const shape shapes[] = {
+        {"medium", 0.1f, 0.1f},
+        {"small", 0.01f, 0.01f},
+        {"tiny", 0.001f, 0.001f},
+        {"wide", 1.0f, 0.0005f},
+    };
+    struct index { const char *name; Solution::level_index index; };
+    const index indices[] = {
+        {"cascading", Solution::cascading_index},
+        {"model", Solution::model_index},
+    };
+
+    size_t differ = 0;
+    std::vector<Point> out(20);
+    for(const index &ix : indices) {
+        const std::string prefix = name(name("search", bench::distribution_name(d)), ix.name);
+        const bool check = ix.index == Solution::model_index &&
+                           bench::enabled(opt, name("check/deadline", bench::distribution_name(d)));
+        if (!bench::enabled(opt, prefix) && !check) {
+            continue;
+        }
+        Solution solution(points.data(), points.data() + points.size(), ix.index);
+        for(const shape &s : shapes) {
+            auto rects = bench::make_rects(1024, s.w, s.h);
+            bench::run(opt, name(prefix, s.name), rects.size(), [&]{
+                for(const Rect &r : rects) {
+                    bench::do_not_optimize(solution.search(r, 20, out.data()));
+                }
+            });
+            if (ix.index == Solution::model_index) {
+                differ += check_deadline(opt, solution, rects, d, s.name);
+            }
+        }
+    }
+    return differ;
+}
+
+/**
+ * Scan the x strip of each rect in every level, with and without skipping blocks
+ * through the zone maps. The heap is reset per level so every level is scanned.
+ */
+void bench_search_strip(const bench::options &opt, const levels &lv, bench::distribution d,
+                        const char *shape, const std::vector<Rect> &rects)
+{
+    if (!opt.csv && bench::enabled(opt, "memory")) {
+        size_t zones = 0;
+        for(size_t level = 0; level < lv.x.size(); level++) {
+            zones += 2 * ((lv.x[level].size() + bin_search::ZONE_SIZE - 1) / bin_search::ZONE_SIZE) * sizeof(bin_search::zone);
+        }
+        std::cout << "memory/" << bench::distribution_name(d) << ": zones " << zones / 1024 << " KiB" << std::endl;
+    }
+
+    for(size_t level = 0; level < lv.x.size(); level++) {
+        const bin_search &mipmap = lv.x[level];
+        std::vector<std::pair<point_index, point_index>> strips;
+        for(const Rect &r : rects) {
+            strips.push_back(std::make_pair(mipmap.lower_bound(r.lx), mipmap.upper_bound(r.hx)));
+        }
+
+        const std::string prefix = name(name(name("search_strip", bench::distribution_name(d)), shape), "level" + str(level));
+        SmallRankHeap heap;
+        bench::run(opt, name(prefix, "scan"), rects.size(), [&]{
+            for(size_t q = 0; q < rects.size(); q++) {
+                heap.reset(20);
+                point_index first = strips[q].first;
+                avx_search_single_bounds(mipmap.other_values() + first, mipmap.indices() + first,
+                                         rects[q].ly, rects[q].hy, strips[q].second - first, heap);
+                bench::do_not_optimize(heap.size());
+            }
+        });
+        bench::run(opt, name(prefix, "zones"), rects.size(), [&]{
+            for(size_t q = 0; q < rects.size(); q++) {
+                heap.reset(20);
+                search_strip(mipmap, strips[q].first, strips[q].second, rects[q].ly, rects[q].hy, heap);
+                bench::do_not_optimize(heap.size());
+            }
+        });
+    }
+}
+
+template<typename Heap>
+void bench_rank_heap(const bench::options &opt, const char *heap_name, size_t max_count)
+{
+    const size_t n_pushes = 4096;
+    std::vector<point_index> ascending(n_pushes), descending(n_pushes), random(n_pushes);
+    for(size_t i = 0; i < n_pushes; i++) {
+        ascending[i] = (point_index)i;
+        descending[i] = (point_index)(n_pushes - i);
+    }
+    random = ascending;
+    std::shuffle(begin(random), end(random), std::mt19937(5));
+
+    struct pattern { const char *name; const std::vector<point_index> *data; };
+    const pattern patterns[] = {
+        {"ascending", &ascending},
+        {"descending", &descending},
+        {"random", &random},
+    };
+    const size_t counts[] = {1, 20, 32, 100};
+
+    for(size_t count : counts) {
+        if (count > max_count) {
+            continue;
+        }
+        for(const pattern &p : patterns) {
+            Heap heap;
+            bench::run(opt, name(heap_name, str(count) + "/" + p.name), n_pushes, [&]{
+                heap.reset(count);
+                for(point_index index : *p.data) {
+                    heap.push(index);
+                }
+                bench::do_not_optimize(heap.top());
+            });
+        }
+    }
+}
+
+void bench_make_cascading(const bench::options &opt, const levels &lv)
+{
+    for(size_t level = 1; level < lv.x.size(); level++) {
+        const std::string suffix = "level" + str(level);
+        bench::run(opt, name("make_lower_cascading", suffix), 1, [&]{
+            bench::do_not_optimize(make_lower_cascading(lv.x[level - 1], lv.x[level]).size());
+        });
+        bench::run(opt, name("make_upper_cascading", suffix), 1, [&]{
+            bench::do_not_optimize(make_upper_cascading(lv.x[level - 1], lv.x[level]).size());
+        });
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    bench::options opt = bench::parse_options(argc, argv);
+    const size_t n_points = std::max(opt.points, (size_t)LINEAR_COUNT);
+
+    bench::print_header(opt);
+    {
+        auto points = bench::make_points(n_points, bench::distribution::uniform);
+        Solution solution(points.data(), points.data() + points.size());
+        bench_search_linear(opt, solution);
+    }
+    bench_avx_search_single_bounds<RankHeap>(opt, "rank_heap");
+    bench_avx_search_single_bounds<SmallRankHeap>(opt, "small_rank_heap");
+    bench_rank_heap<RankHeap>(opt, "rank_heap", std::numeric_limits<size_t>::max());
+    bench_rank_heap<SmallRankHeap>(opt, "small_rank_heap", SmallRankHeap::max_capacity);
+
+    size_t failures = 0;
+    const bench::distribution distributions[] = {
+        bench::distribution::uniform,
+        bench::distribution::skewed,
+        bench::distribution::cross
+    };
+    for(bench::distribution d : distributions) {
+        auto points = bench::make_points(n_points, d);
+        failures += bench_search(opt, points, d);
+        if (d != bench::distribution::cross) {
+            failures += check_index(opt, points, d);
+        }
+
+        std::sort(begin(points), end(points), util::point_rank_less);
+        levels lv = make_levels(points);
+        if (d == bench::distribution::cross) {
+            bench_search_strip(opt, lv, d, "center", bench::make_center_rects(256));
+            continue;
+        }
+        print_index_memory(opt, lv, d);
+        bench_bin_search(opt, lv, d);
+        bench_search_strip(opt, lv, d, "small", bench::make_rects(256, 0.01f, 0.01f));
+        if (d == bench::distribution::uniform) {
+            bench_make_cascading(opt, lv);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "point_search.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace bench {
+
+    enum class distribution {
+        // x and y uniform in [0, 1)
+        uniform,
+        // most points are packed in a few tight clusters, the rest is uniform.
+        skewed,
+        // the worst case from the readme: four arms around an empty square
+        // [0.4, 0.6] x [0.4, 0.6]. See make_center_rects().
+        cross
+    };
+
+    inline const char *distribution_name(distribution d) {
+        switch(d) {
+        case distribution::uniform: return "uniform";
+        case distribution::skewed: return "skewed";
+        case distribution::cross: return "cross";
+        }
+        return "";
+    }
+
+    /**
+     * Generate n points with unique ranks [0, n) in random order, like the points
+     * handed to create() by the test application.
+     */
+    inline std::vector<Point> make_points(size_t n, distribution d, unsigned seed = 1) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        std::vector<point_index> ranks(n);
+        std::iota(begin(ranks), end(ranks), 0);
+        std::shuffle(begin(ranks), end(ranks), rng);
+
+        const int n_clusters = 16;
+        std::vector<std::pair<float, float>> centers;
+        for(int i = 0; i < n_clusters; i++) {
+            centers.push_back(std::make_pair(unit(rng), unit(rng)));
+        }
+        std::normal_distribution<float> spread(0.0f, 0.01f);
+        std::uniform_int_distribution<int> pick(0, n_clusters - 1);
+        std::uniform_real_distribution<float> arm_width(0.4f, 0.6f);
+        std::uniform_real_distribution<float> arm_length(0.0f, 0.4f);
+
+        std::vector<Point> points(n);
+        for(size_t i = 0; i < n; i++) {
+            Point &p = points[i];
+            p.id = (int8_t)i;
+            p.rank = ranks[i];
+            if (d == distribution::skewed && unit(rng) < 0.9f) {
+                auto c = centers[pick(rng)];
+                p.x = c.first + spread(rng);
+                p.y = c.second + spread(rng);
+            } else if (d == distribution::cross) {
+                // arm 0 and 1 are below and above the square, 2 and 3 left and right.
+                int arm = (int)(i % 4);
+                float across = arm_width(rng);
+                float along = arm_length(rng) + (arm % 2 ? 0.6f : 0.0f);
+                p.x = arm < 2 ? across : along;
+                p.y = arm < 2 ? along : across;
+            } else {
+                p.x = unit(rng);
+                p.y = unit(rng);
+            }
+        }
+        return points;
+    }
+
+    /**
+     * Generate n rects of the given size at random positions inside the unit square.
+     */
+    inline std::vector<Rect> make_rects(size_t n, float width, float height, unsigned seed = 2) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> x(0.0f, std::max(0.0f, 1.0f - width));
+        std::uniform_real_distribution<float> y(0.0f, std::max(0.0f, 1.0f - height));
+
+        std::vector<Rect> rects(n);
+        for(Rect &r : rects) {
+            r.lx = x(rng);
+            r.ly = y(rng);
+            r.hx = r.lx + width;
+            r.hy = r.ly + height;
+        }
+        return rects;
+    }
+
+    /**
+     * Rects inside the empty square of distribution::cross. Both the x and y
+     * strip of these rects hold about half of the points while the rect holds none.
+     */
+    inline std::vector<Rect> make_center_rects(size_t n, unsigned seed = 3) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> inset(0.0f, 0.05f);
+
+        std::vector<Rect> rects(n);
+        for(Rect &r : rects) {
+            r.lx = 0.4f + inset(rng);
+            r.ly = 0.4f + inset(rng);
+            r.hx = 0.6f - inset(rng);
+            r.hy = 0.6f - inset(rng);
+        }
+        return rects;
+    }
+}
+
+#endif // DATASET_H
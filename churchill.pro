@@ -7,7 +7,10 @@ TARGET = stefan
 SOURCES += \
     src/solution.cpp \
     src/dll.cpp \
-    src/binary_search.cpp
+    src/binary_search.cpp \
+    src/position_model.cpp \
+    src/query_trace.cpp \
+    src/managed_context.cpp
 
 include(deployment.pri)
 qtcAddDeployment()
@@ -20,7 +23,11 @@ HEADERS += \
     src/timer.h \
     src/aligned_allocator.h \
     src/binary_search.h \
-    src/rank_heap.h
+    src/position_model.h \
+    src/rank_heap.h \
+    src/small_rank_heap.h \
+    src/query_trace.h \
+    src/managed_context.h
 
 DEFINES += CHURCHILL_EXPORTS
 
@@ -3,7 +3,10 @@
 
 #ifdef _WIN32
 #include <malloc.h>
+#else
+#include <mm_malloc.h>
 #endif
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
 #include <limits>
@@ -1,6 +1,15 @@
 #include "binary_search.h"
 
-
-
-
-
+void bin_search::build_zones()
+{
+    m_zones.clear();
+    for(point_index first = 0; first < size(); first += ZONE_SIZE) {
+        point_index last = std::min(size(), first + ZONE_SIZE);
+        auto other = std::minmax_element(begin(m_other_values) + first, begin(m_other_values) + last);
+        zone z;
+        z.min_other = *other.first;
+        z.max_other = *other.second;
+        z.min_rank = *std::min_element(begin(m_indices) + first, begin(m_indices) + last);
+        m_zones.push_back(z);
+    }
+}
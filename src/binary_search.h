@@ -3,16 +3,30 @@
 
 #include "point_search.h"
 #include "aligned_allocator.h"
+#include "position_model.h"
 
 #include "util.h"
 
 #include <vector>
 #include <algorithm>
 
+#include <xmmintrin.h>
+
 
 
 class bin_search {
 public:
+    /**
+     * Summary of ZONE_SIZE consecutive points, used to skip whole blocks
+     * during the scan of an strip.
+     */
+    struct zone {
+        float min_other;
+        float max_other;
+        point_index min_rank;
+    };
+    static const point_index ZONE_SIZE = 512;
+
     bin_search() {}
 
 
@@ -22,10 +36,21 @@ public:
     point_index upper_bound(float value) const {return upper_bound(value, 0, (point_index)m_values.size());}
     point_index upper_bound(float value, point_index first, point_index last) const;
 
+    /**
+     * lower_bound() and upper_bound() over the entire range, accelerated by the position
+     * model. build_model() must have been called first.
+     */
+    point_index model_lower_bound(float value) const;
+    point_index model_upper_bound(float value) const;
+    void build_model(point_index epsilon) {m_model = position_model(m_values.data(), size(), epsilon);}
+    const position_model &model() const {return m_model;}
+
     point_index size() const {return m_values.size();}
     const float* values() const {return m_values.data();}
     const float* other_values() const {return m_other_values.data();}
     const point_index* indices() const {return m_indices.data();}
+    // zones()[i] covers the points [i * ZONE_SIZE, (i + 1) * ZONE_SIZE)
+    const zone* zones() const {return m_zones.data();}
 
 
     template<typename It>
@@ -34,9 +59,17 @@ public:
     friend bin_search make_bin_search_from_y(It first, It last);
 
 private:
+    // branchless versions for the small windows predicted by the model.
+    void prefetch_window(point_index first, point_index last) const;
+    void build_zones();
+    point_index window_lower_bound(float value, point_index first, point_index last) const;
+    point_index window_upper_bound(float value, point_index first, point_index last) const;
+
     std::vector<float, aligned_allocator<float, 64>> m_values; // sorted
     std::vector<float, aligned_allocator<float, 64>> m_other_values;
-    std::vector<point_index, aligned_allocator<float, 64>> m_indices;
+    std::vector<point_index, aligned_allocator<point_index, 64>> m_indices;
+    std::vector<zone> m_zones;
+    position_model m_model;
 };
 
 inline point_index bin_search::lower_bound(float value, point_index first, point_index last) const
@@ -57,6 +90,84 @@ inline point_index bin_search::upper_bound(float value, point_index first, point
     return (point_index)std::distance(begin(m_values), it);
 }
 
+/**
+ * Request all cache lines of the window at once, the loads of the binary search
+ * depend on each other and would otherwise miss one after another.
+ */
+inline void bin_search::prefetch_window(point_index first, point_index last) const
+{
+    const point_index floats_per_line = 64 / sizeof(float);
+    for(point_index i = first & ~(floats_per_line - 1); i < last; i += floats_per_line) {
+        _mm_prefetch((const char*)(m_values.data() + i), _MM_HINT_T0);
+    }
+}
+
+inline point_index bin_search::window_lower_bound(float value, point_index first, point_index last) const
+{
+    const float *base = m_values.data() + first;
+    point_index n = last - first;
+    if (n <= 0) {
+        return first;
+    }
+    while(n > 1) {
+        point_index half = n / 2;
+        // written as arithmetic, gcc turns the ternary into a branch.
+        base += (base[half - 1] < value) * half;
+        n -= half;
+    }
+    return (point_index)(base - m_values.data()) + (*base < value);
+}
+
+inline point_index bin_search::window_upper_bound(float value, point_index first, point_index last) const
+{
+    const float *base = m_values.data() + first;
+    point_index n = last - first;
+    if (n <= 0) {
+        return first;
+    }
+    while(n > 1) {
+        point_index half = n / 2;
+        base += (base[half - 1] <= value) * half;
+        n -= half;
+    }
+    return (point_index)(base - m_values.data()) + (*base <= value);
+}
+
+inline point_index bin_search::model_lower_bound(float value) const
+{
+    const point_index n = size();
+    const point_index guess = std::max(0, std::min(n, m_model.predict(value)));
+    const point_index first = std::max(0, guess - m_model.epsilon());
+    const point_index last  = std::min(n, guess + m_model.epsilon() + 1);
+
+    prefetch_window(first, last);
+    point_index result = window_lower_bound(value, first, last);
+    // only long runs of equal values end up outside the window.
+    if (result == first && first > 0 && m_values[first - 1] >= value) {
+        result = lower_bound(value, 0, first);
+    } else if (result == last && last < n && m_values[last] < value) {
+        result = lower_bound(value, last, n);
+    }
+    return result;
+}
+
+inline point_index bin_search::model_upper_bound(float value) const
+{
+    const point_index n = size();
+    const point_index guess = std::max(0, std::min(n, m_model.predict(value)));
+    const point_index first = std::max(0, guess - m_model.epsilon());
+    const point_index last  = std::min(n, guess + m_model.epsilon() + 1);
+
+    prefetch_window(first, last);
+    point_index result = window_upper_bound(value, first, last);
+    if (result == first && first > 0 && m_values[first - 1] > value) {
+        result = upper_bound(value, 0, first);
+    } else if (result == last && last < n && m_values[last] <= value) {
+        result = upper_bound(value, last, n);
+    }
+    return result;
+}
+
 template<typename It>
 bin_search make_bin_search_from_x(It first, It last)
 {
@@ -71,6 +182,7 @@ bin_search make_bin_search_from_x(It first, It last)
         result.m_other_values.push_back(p.y);
         result.m_indices.push_back(p.rank);
     }
+    result.build_zones();
     return std::move(result);
 }
 
@@ -88,6 +200,7 @@ bin_search make_bin_search_from_y(It first, It last)
         result.m_other_values.push_back(p.x);
         result.m_indices.push_back(p.rank);
     }
+    result.build_zones();
     return std::move(result);
 }
 
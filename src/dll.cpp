@@ -1,35 +1,105 @@
 #include "dll.h"
 
-#include "solution.h"
-#include "timer.h"
+#include "managed_context.h"
+#include "query_trace.h"
 
-//std::vector<double> m_times;
+#include <atomic>
+#include <cstdlib>
+
+// Set CHURCHILL_TRACE=<file> to record every search() on the first context to <file>.
+// The points passed to create() are written to <file>.points, so the trace can be
+// replayed offline with churchill_replay. The trace stops at the first reload() of
+// that context, the searches after it run on other points.
+static QueryTrace *g_trace = nullptr;
+static SearchContext *g_trace_context = nullptr;
+static std::atomic<bool> g_tracing(false);
+
+/**
+ * Run search() and record it if it ran on the traced points. budget_ns is
+ * negative for search(), the budget of an search_with_deadline() otherwise.
+ */
+template<typename F>
+static point_index traced(SearchContext *sc, const Rect &rect, const point_index count, int64_t budget_ns, F search)
+{
+    if (!g_trace || sc != g_trace_context || !g_tracing.load()) {
+        return search();
+    }
+
+    auto start = g_trace->now();
+    point_index result = search();
+    auto stop = g_trace->now();
+    // g_tracing is cleared before reload() starts, so if it's still set the
+    // search picked its Solution before the swap.
+    if (g_tracing.load()) {
+        g_trace->record(rect, count, result, start, stop, budget_ns);
+    }
+    return result;
+}
 
 SearchContext* create(const Point *points_begin, const Point *points_end)
 {
-//    m_times.reserve(1000);
-    return (SearchContext*)new Solution(points_begin, points_end);
+    SearchContext *sc = (SearchContext*)new ManagedContext(points_begin, points_end);
+
+    const char *path = getenv("CHURCHILL_TRACE");
+    if (path && *path && !g_trace) {
+        std::string trace_path(path);
+        if (trace::write_points(trace_path + ".points", points_begin, points_end)) {
+            g_trace = new QueryTrace(trace_path);
+            g_trace_context = sc;
+            g_tracing = true;
+            if (!g_trace->is_open()) {
+                delete g_trace;
+                g_trace = nullptr;
+                g_trace_context = nullptr;
+                g_tracing = false;
+            }
+        }
+    }
+    return sc;
 }
 
 point_index search(SearchContext *sc, const Rect rect, const point_index count, Point *out_points)
 {
-    Solution* sol = (Solution*)sc;
-//    rdtsc_timer timer;
-    auto result = sol->search(rect, count, out_points);
-//    m_times.push_back(timer.elapsed());
+    ManagedContext* sol = (ManagedContext*)sc;
+    return traced(sc, rect, count, -1, [&]{
+        return sol->search(rect, count, out_points);
+    });
+}
+
+point_index search_with_deadline(SearchContext *sc, const Rect rect, const point_index count, Point *out_points,
+                                 int64_t budget_ns, SearchStatus *status)
+{
+    ManagedContext* sol = (ManagedContext*)sc;
+    search_status result_status;
+    point_index result = traced(sc, rect, count, budget_ns, [&]{
+        return sol->search_with_deadline(rect, count, out_points, budget_ns, &result_status);
+    });
+
+    if (status) {
+        status->exact = result_status.exact;
+        status->complete_rank = result_status.complete_rank;
+    }
     return result;
 }
 
+int32_t reload(SearchContext *sc, const Point *points_begin, const Point *points_end)
+{
+    // the trace object stays alive until destroy(), searches may still be recording.
+    if (sc == g_trace_context) {
+        g_tracing = false;
+    }
+    return ((ManagedContext*)sc)->reload(points_begin, points_end) ? 1 : 0;
+}
 
 SearchContext *destroy(SearchContext *sc)
 {
-//    for(double d : m_times)
-//    {
-//        std::cout << d * 1000 << std::endl;
-//    }
-//    std::cout << "====" << std::endl;
-//    m_times.clear();
-
-    delete (Solution*)sc;
+    if (sc == g_trace_context) {
+        g_tracing = false;
+        delete g_trace;
+        g_trace = nullptr;
+        g_trace_context = nullptr;
+    }
+
+    delete (ManagedContext*)sc;
     return nullptr;
 }
@@ -2,19 +2,47 @@
 #define DLL_H
 
 
+#ifdef _WIN32
 #ifdef CHURCHILL_EXPORTS
 #define CHURCHILL_API __declspec(dllexport)
 #else
 #define CHURCHILL_API __declspec(dllimport)
 #endif
+#else
+// on linux the library is built with -fvisibility=hidden, only the entry points are exported.
+#define CHURCHILL_API __attribute__((visibility("default")))
+#endif
 
 #include "point_search.h"
 
 extern "C" {
 
+/* Outcome of search_with_deadline(). "exact" is nonzero if the result is the same as the result of search(). Every
+point inside the rect with a rank below "complete_rank" is in the result, unless the result already holds "count"
+points with lower ranks. */
+struct SearchStatus
+{
+	int32_t exact;
+	int32_t complete_rank;
+};
+
+/* search() that returns the best points found so far after about "budget_ns" nanoseconds. Optional, not part of the
+challenge interface. */
+typedef int32_t (__stdcall* T_search_with_deadline)(SearchContext* sc, const Rect rect, const int32_t count, Point* out_points,
+                                                    int64_t budget_ns, SearchStatus* status);
+
+/* Replace the points of "sc" without blocking the searches on it. The new data structure is built on a background
+thread, searches use the old points until it is done. The points are copied before the call returns. Returns 1 if the
+reload was started, 0 if the previous reload of "sc" hasn't finished yet. Optional, not part of the challenge
+interface. */
+typedef int32_t (__stdcall* T_reload)(SearchContext* sc, const Point* points_begin, const Point* points_end);
+
 CHURCHILL_API SearchContext* __stdcall create(const Point* points_begin, const Point* points_end);
 CHURCHILL_API point_index __stdcall search(SearchContext* sc, const Rect rect, const point_index count, Point* out_points);
 CHURCHILL_API SearchContext* __stdcall destroy(SearchContext* sc);
+CHURCHILL_API point_index __stdcall search_with_deadline(SearchContext* sc, const Rect rect, const point_index count, Point* out_points,
+                                                         int64_t budget_ns, SearchStatus* status);
+CHURCHILL_API int32_t __stdcall reload(SearchContext* sc, const Point* points_begin, const Point* points_end);
 
 }
 
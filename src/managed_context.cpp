@@ -0,0 +1,95 @@
+#include "managed_context.h"
+
+#include <utility>
+
+ManagedContext::ManagedContext(const Point *points_begin, const Point *points_end)
+    :   m_current(new Solution(points_begin, points_end))
+    ,   m_epoch(0)
+    ,   m_reloading(false)
+{
+    m_readers[0] = 0;
+    m_readers[1] = 0;
+}
+
+ManagedContext::~ManagedContext()
+{
+    wait();
+    delete m_current.load();
+}
+
+bool ManagedContext::reload(const Point *points_begin, const Point *points_end)
+{
+    if (m_reloading.exchange(true)) {
+        return false;
+    }
+
+    // the previous build thread is done, but still has to be joined.
+    wait();
+    m_thread = std::thread(&ManagedContext::build, this, std::vector<Point>(points_begin, points_end));
+    return true;
+}
+
+void ManagedContext::wait()
+{
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+point_index ManagedContext::search(const Rect rect, const point_index count, Point *out_points)
+{
+    reader r(*this);
+    return r.solution()->search(rect, count, out_points);
+}
+
+point_index ManagedContext::search_with_deadline(const Rect rect, const point_index count, Point *out_points,
+                                                 const int64_t budget_ns, search_status *status)
+{
+    reader r(*this);
+    return r.solution()->search_with_deadline(rect, count, out_points, budget_ns, status);
+}
+
+void ManagedContext::build(std::vector<Point> points)
+{
+    Solution *solution = new Solution(points.data(), points.data() + points.size());
+    // Solution keeps its own copy, release ours before the swap so no more
+    // than the two Solutions are alive while the old one drains.
+    std::vector<Point>().swap(points);
+
+    publish(solution);
+    m_reloading.store(false, std::memory_order_release);
+}
+
+void ManagedContext::publish(Solution *solution)
+{
+    Solution *old = m_current.exchange(solution);
+
+    // searches that register from now on see the new epoch, and with it the
+    // new Solution. Wait for the ones registered in the previous epoch.
+    uint64_t epoch = m_epoch.fetch_add(1);
+    while(m_readers[epoch & 1].load() != 0) {
+        std::this_thread::yield();
+    }
+    delete old;
+}
+
+ManagedContext::reader::reader(ManagedContext &context)
+{
+    // if the epoch moved on between reading it and registering, an publish()
+    // may already be waiting on the other counter. Register again.
+    for(;;) {
+        uint64_t epoch = context.m_epoch.load();
+        m_counter = &context.m_readers[epoch & 1];
+        m_counter->fetch_add(1);
+        if (context.m_epoch.load() == epoch) {
+            break;
+        }
+        m_counter->fetch_sub(1);
+    }
+    m_solution = context.m_current.load();
+}
+
+ManagedContext::reader::~reader()
+{
+    m_counter->fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,93 @@
+#ifndef MANAGED_CONTEXT_H
+#define MANAGED_CONTEXT_H
+
+#include "point_search.h"
+#include "solution.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * Owns the Solution that searches run on, and replaces it with an Solution
+ * for new points without stopping the searches.
+ *
+ * reload() builds the new Solution on a background thread while searches
+ * keep using the current one. The new Solution is published with an atomic
+ * pointer swap, the old one is deleted once the searches that may still use
+ * it are done. At most one reload runs at a time, so there are never more
+ * than two Solutions alive.
+ *
+ * The reclamation is epoch based. A search registers itself in the counter
+ * of the current epoch before it loads the pointer. After the swap the epoch
+ * is advanced, and the old Solution is deleted when the counter of the
+ * previous epoch drops to zero. Searches that start after the swap register
+ * in the new epoch, so the wait is bounded by the searches in flight.
+ */
+class ManagedContext
+{
+public:
+    ManagedContext(const Point *points_begin, const Point *points_end);
+
+    /**
+     * Waits for an running reload. No search may be in flight.
+     */
+    ~ManagedContext();
+
+    /**
+     * reload(), wait() and the destructor are meant to be called from one
+     * thread, search() from any number of threads.
+     *
+     * Start building an Solution for the given points on a background thread.
+     * The points are copied before reload() returns. Returns false if the
+     * previous reload hasn't finished yet.
+     */
+    bool reload(const Point *points_begin, const Point *points_end);
+
+    /**
+     * True while an reload is building or waiting for searches to finish.
+     */
+    bool reloading() const {return m_reloading.load(std::memory_order_acquire);}
+
+    /**
+     * Block until the running reload, if any, has swapped and reclaimed.
+     */
+    void wait();
+
+    point_index search(const Rect rect, const point_index count, Point *out_points);
+    point_index search_with_deadline(const Rect rect, const point_index count, Point *out_points,
+                                     const int64_t budget_ns, search_status *status);
+
+private:
+    /**
+     * Registers the calling search in the current epoch for as long as it lives.
+     */
+    class reader {
+    public:
+        explicit reader(ManagedContext &context);
+        ~reader();
+
+        Solution *solution() const {return m_solution;}
+
+    private:
+        std::atomic<int> *m_counter;
+        Solution *m_solution;
+    };
+
+    // runs on m_thread
+    void build(std::vector<Point> points);
+    void publish(Solution *solution);
+
+    std::atomic<Solution*> m_current;
+    std::atomic<uint64_t> m_epoch;
+    // searches in flight per epoch parity. Every search writes here, keep it
+    // away from the fields that are only read. The padding is explicit, new
+    // doesn't honour alignas(64) before C++17.
+    char m_padding0[64];
+    std::atomic<int> m_readers[2];
+    char m_padding1[64];
+    std::atomic<bool> m_reloading;
+    std::thread m_thread;
+};
+
+#endif // MANAGED_CONTEXT_H
@@ -12,6 +12,11 @@ implements this interface. */
 /* This standard header defines the sized types used. */
 #include <stdint.h>
 
+/* Calling conventions only exist on 32/64 bit windows, elsewhere the default convention is used. */
+#if !defined(_WIN32) && !defined(__stdcall)
+#define __stdcall
+#endif
+
 /* The following structs are packed with no padding. */
 #pragma pack(push, 1)
 
@@ -0,0 +1,76 @@
+#include "position_model.h"
+
+#include <limits>
+
+namespace {
+    point_index next_distinct(const float *values, point_index size, point_index i)
+    {
+        point_index j = i + 1;
+        while(j < size && values[j] == values[i]) {
+            j++;
+        }
+        return j;
+    }
+}
+
+/**
+ * Greedy 'shrinking cone' fit: every segment starts at a distinct value and keeps the
+ * range of slopes for which all distinct values seen so far are predicted within the
+ * error bound. The segment ends when that range becomes empty.
+ */
+position_model::position_model(const float *values, point_index size, point_index epsilon)
+    :   m_epsilon(epsilon)
+    ,   m_min(0)
+    ,   m_scale(0)
+{
+    if (size == 0) {
+        return;
+    }
+
+    // predict() truncates, which may cost one position. Fit one position tighter.
+    const double fit_error = std::max(0, epsilon - 1);
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    point_index i = 0;
+    while(i < size) {
+        segment s;
+        s.key = values[i];
+        s.first = i;
+
+        double low = 0;
+        double high = infinity;
+        point_index j = next_distinct(values, size, i);
+        for(; j < size; j = next_distinct(values, size, j)) {
+            double dx = (double)values[j] - s.key;
+            double new_low  = std::max(low,  (j - fit_error - i) / dx);
+            double new_high = std::min(high, (j + fit_error - i) / dx);
+            if (new_low > new_high) {
+                break;
+            }
+            low = new_low;
+            high = new_high;
+        }
+
+        s.last = j;
+        s.slope = high == infinity ? 0 : (float)((low + high) / 2);
+        m_segments.push_back(s);
+        i = j;
+    }
+
+    // radix table over the value range, sized to roughly one segment per bucket.
+    point_index buckets = 1;
+    while(buckets < (point_index)m_segments.size()) {
+        buckets *= 2;
+    }
+    m_min = m_segments.front().key;
+    float range = values[size - 1] - m_min;
+    m_scale = range > 0 ? buckets / range : 0;
+
+    m_radix.assign(buckets + 1, 0);
+    for(const segment &s : m_segments) {
+        m_radix[bucket(s.key) + 1]++;
+    }
+    for(point_index b = 0; b < buckets; b++) {
+        m_radix[b + 1] += m_radix[b];
+    }
+}
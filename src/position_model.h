@@ -0,0 +1,109 @@
+#ifndef POSITION_MODEL_H
+#define POSITION_MODEL_H
+
+#include "point_search.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Piecewise linear model that maps a value to its approximate position in a sorted
+ * array of floats.
+ *
+ * The array is split into segments. Within a segment the position of each distinct
+ * value is predicted by a straight line, and the prediction is at most 'epsilon'
+ * positions off. A query first finds its segment through a radix table over the
+ * value range, then evaluates the line. The caller only has to search the
+ * window [predict - epsilon, predict + epsilon + 1] instead of the entire array.
+ *
+ * Long runs of equal values can push the answer outside of that window, the
+ * caller is expected to check the window bounds (see bin_search).
+ */
+class position_model {
+public:
+    position_model()
+        :   m_epsilon(0)
+        ,   m_min(0)
+        ,   m_scale(0)
+    {}
+
+    position_model(const float *values, point_index size, point_index epsilon);
+
+    point_index epsilon() const {return m_epsilon;}
+    bool empty() const {return m_segments.empty();}
+    size_t segments() const {return m_segments.size();}
+    size_t memory_usage() const {
+        return m_segments.size() * sizeof(segment) + m_radix.size() * sizeof(point_index);
+    }
+
+    /**
+     * Approximate position of 'value', in the range [0, size]
+     */
+    point_index predict(float value) const;
+
+private:
+    // 16 bytes, 4 segments per cache line.
+    struct segment {
+        float key;          // first value in this segment
+        float slope;
+        point_index first;  // position of key
+        point_index last;   // position of the first value in the next segment
+    };
+
+    point_index bucket(float value) const;
+    point_index find_segment(float value) const;
+
+    std::vector<segment> m_segments;
+    // m_radix[b] is the number of segments whose key falls in a bucket before b.
+    std::vector<point_index> m_radix;
+    point_index m_epsilon;
+    float m_min;
+    float m_scale;
+};
+
+inline point_index position_model::bucket(float value) const
+{
+    float offset = (value - m_min) * m_scale;
+    return (point_index)std::max(0.0f, std::min(offset, (float)(m_radix.size() - 2)));
+}
+
+/**
+ * Index of the last segment whose key is <= value, or -1.
+ */
+inline point_index position_model::find_segment(float value) const
+{
+    point_index b = bucket(value);
+    const segment *base = m_segments.data() + m_radix[b];
+    point_index n = m_radix[b + 1] - m_radix[b];
+    if (n == 0) {
+        return m_radix[b] - 1;
+    }
+    // branchless upper_bound, the buckets are tiny.
+    while(n > 1) {
+        point_index half = n / 2;
+        base = (base[half].key <= value) ? base + half : base;
+        n -= half;
+    }
+    return (point_index)(base - m_segments.data()) - (base->key > value);
+}
+
+inline point_index position_model::predict(float value) const
+{
+    point_index index = find_segment(value);
+    if (index < 0) {
+        return 0;
+    }
+
+    // the offset is clamped to the segment, float precision is plenty. An
+    // segment of one distinct value has slope 0, and 0 * inf is NaN for an
+    // infinite value, the negated compare sends NaN to the segment start.
+    const segment &s = m_segments[index];
+    float offset = s.slope * (value - s.key);
+    if (!(offset > 0)) {
+        offset = 0;
+    }
+    offset = std::min(offset, (float)(s.last - s.first));
+    return s.first + (point_index)offset;
+}
+
+#endif // POSITION_MODEL_H
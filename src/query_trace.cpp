@@ -0,0 +1,149 @@
+#include "query_trace.h"
+
+#include <cstring>
+
+namespace {
+    const char TRACE_MAGIC[4] = {'C', 'H', 'T', 'R'};
+    // version 2 added TraceRecord::budget_ns.
+    const uint32_t TRACE_VERSION = 2;
+
+    // at 48 bytes per record this is 3MiB, enough to buffer ~65k queries.
+    const size_t RING_CAPACITY = 1 << 16;
+    const size_t WRITE_BATCH = 1024;
+
+    TraceHeader make_header(uint64_t records, uint64_t dropped)
+    {
+        TraceHeader header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(TraceRecord);
+        header.records = records;
+        header.dropped = dropped;
+        return header;
+    }
+}
+
+QueryTrace::QueryTrace(const std::string &path)
+    :   m_ring(RING_CAPACITY)
+    ,   m_file(std::fopen(path.c_str(), "wb"))
+    ,   m_epoch(clock::now())
+    ,   m_written(0)
+    ,   m_dropped(0)
+    ,   m_running(false)
+{
+    if (!m_file) {
+        return;
+    }
+
+    // the header is rewritten with the final counts when the trace is closed.
+    TraceHeader header = make_header(0, 0);
+    std::fwrite(&header, sizeof(header), 1, m_file);
+
+    m_running = true;
+    m_thread = std::thread(&QueryTrace::writer, this);
+}
+
+QueryTrace::~QueryTrace()
+{
+    if (!m_file) {
+        return;
+    }
+
+    m_running = false;
+    m_thread.join();
+    drain();
+
+    TraceHeader header = make_header(m_written, m_dropped.load());
+    std::fseek(m_file, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, m_file);
+    std::fclose(m_file);
+}
+
+void QueryTrace::writer()
+{
+    while(m_running.load(std::memory_order_relaxed)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } else {
+            // hand the records to the os, so they survive if the process is killed.
+            std::fflush(m_file);
+        }
+    }
+}
+
+size_t QueryTrace::drain()
+{
+    TraceRecord batch[WRITE_BATCH];
+    size_t total = 0;
+    size_t n;
+    while((n = m_ring.pop(batch, WRITE_BATCH)) != 0) {
+        std::fwrite(batch, sizeof(TraceRecord), n, m_file);
+        total += n;
+    }
+    m_written += total;
+    return total;
+}
+
+bool trace::read(const std::string &path, TraceHeader &header, std::vector<TraceRecord> &records)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == TRACE_VERSION &&
+              header.record_size == sizeof(TraceRecord);
+
+    // the header only holds the final count after the trace was closed. If the
+    // process died before that, the records that made it to disk are still good.
+    std::fseek(file, 0, SEEK_END);
+    long bytes = std::ftell(file);
+    std::fseek(file, sizeof(header), SEEK_SET);
+    uint64_t on_disk = bytes >= (long)sizeof(header) ? (bytes - sizeof(header)) / sizeof(TraceRecord) : 0;
+
+    if (ok && header.records == 0) {
+        header.records = on_disk;
+    }
+    ok = ok && header.records == on_disk;
+    if (ok) {
+        records.resize((size_t)header.records);
+        ok = std::fread(records.data(), sizeof(TraceRecord), records.size(), file) == records.size();
+    }
+    std::fclose(file);
+    return ok;
+}
+
+bool trace::write_points(const std::string &path, const Point *points_begin, const Point *points_end)
+{
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    size_t n = points_end - points_begin;
+    bool ok = std::fwrite(points_begin, sizeof(Point), n, file) == n;
+    std::fclose(file);
+    return ok;
+}
+
+bool trace::read_points(const std::string &path, std::vector<Point> &points)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    std::fseek(file, 0, SEEK_END);
+    long bytes = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+
+    bool ok = bytes >= 0 && (bytes % sizeof(Point)) == 0;
+    if (ok) {
+        points.resize(bytes / sizeof(Point));
+        ok = std::fread(points.data(), sizeof(Point), points.size(), file) == points.size();
+    }
+    std::fclose(file);
+    return ok;
+}
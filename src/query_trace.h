@@ -0,0 +1,178 @@
+#ifndef QUERY_TRACE_H
+#define QUERY_TRACE_H
+
+#include "point_search.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* The trace file is a TraceHeader followed by header.records TraceRecords. */
+#pragma pack(push, 1)
+
+struct TraceHeader
+{
+    char magic[4];          // "CHTR"
+    uint32_t version;
+    uint32_t record_size;   // sizeof(TraceRecord), for sanity checking.
+    uint64_t records;       // 0 until the trace is closed, see trace::read().
+    uint64_t dropped;       // records lost because the writer could not keep up.
+};
+
+struct TraceRecord
+{
+    Rect rect;
+    point_index count;
+    point_index result;     // number of points returned by search()
+    uint64_t start_ns;      // relative to the start of the trace
+    uint64_t duration_ns;
+    int64_t budget_ns;      // budget of an search_with_deadline(), negative for search()
+};
+
+#pragma pack(pop)
+
+/**
+ * Multiple producer, single consumer ring buffer. push() never blocks, if the
+ * buffer is full the record is dropped. The capacity must be a power of two.
+ *
+ * Producers claim an slot by advancing m_head. Each slot has an sequence
+ * number that tells whose turn it is: 'position' when it's free for the
+ * producer of that position, 'position + 1' once the record is written, and
+ * 'position + capacity' after the consumer took it.
+ */
+class TraceRing
+{
+public:
+    explicit TraceRing(size_t capacity)
+        :   m_slots(capacity)
+        ,   m_mask(capacity - 1)
+        ,   m_head(0)
+        ,   m_tail(0)
+    {
+        for(size_t i = 0; i < capacity; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const TraceRecord &record) {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        for(;;) {
+            slot &s = m_slots[head & m_mask];
+            uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+            if (sequence == head) {
+                if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    s.record = record;
+                    s.sequence.store(head + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < head) {
+                // the consumer hasn't taken the record of the previous round yet.
+                return false;
+            } else {
+                head = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Copy at most max_count records to out, return the number of records copied.
+     * Stops early at an slot that was claimed but isn't written yet.
+     */
+    size_t pop(TraceRecord *out, size_t max_count) {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t n = 0;
+        for(; n < max_count; n++) {
+            slot &s = m_slots[(tail + n) & m_mask];
+            if (s.sequence.load(std::memory_order_acquire) != tail + n + 1) {
+                break;
+            }
+            out[n] = s.record;
+            s.sequence.store(tail + n + m_slots.size(), std::memory_order_release);
+        }
+        m_tail.store(tail + n, std::memory_order_relaxed);
+        return n;
+    }
+
+private:
+    struct slot {
+        std::atomic<uint64_t> sequence;
+        TraceRecord record;
+    };
+
+    std::vector<slot> m_slots;
+    const uint64_t m_mask;
+    // the producers and the consumer counters are kept on separate cache lines.
+    // The padding is explicit, new doesn't honour alignas(64) before C++17.
+    char m_padding0[64];
+    std::atomic<uint64_t> m_head;
+    char m_padding1[64];
+    std::atomic<uint64_t> m_tail;
+    char m_padding2[64];
+};
+
+/**
+ * Records every search() call to a binary trace file. The query threads only
+ * push into a TraceRing, a background thread writes the records to disk.
+ */
+class QueryTrace
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * Open 'path' for writing. Check is_open() for success.
+     */
+    explicit QueryTrace(const std::string &path);
+    ~QueryTrace();
+
+    bool is_open() const {return m_file != nullptr;}
+
+    clock::time_point now() const {return clock::now();}
+
+    void record(const Rect &rect, point_index count, point_index result,
+                clock::time_point start, clock::time_point stop, int64_t budget_ns = -1) {
+        TraceRecord r;
+        r.rect = rect;
+        r.count = count;
+        r.result = result;
+        r.start_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_epoch).count();
+        r.duration_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+        r.budget_ns = budget_ns;
+        if (!m_ring.push(r)) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void writer();
+    size_t drain();
+
+    TraceRing m_ring;
+    std::FILE *m_file;
+    clock::time_point m_epoch;
+    uint64_t m_written;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+namespace trace {
+    /**
+     * Read a trace written by QueryTrace. Returns false if the file can not be
+     * read or is not a trace. The records of an trace that was never closed,
+     * because the process crashed or was killed, are read up to the last
+     * complete record and header.records is set to their count.
+     */
+    bool read(const std::string &path, TraceHeader &header, std::vector<TraceRecord> &records);
+
+    /**
+     * Points are stored as a raw array of the packed Point struct.
+     */
+    bool write_points(const std::string &path, const Point *points_begin, const Point *points_end);
+    bool read_points(const std::string &path, std::vector<Point> &points);
+}
+
+#endif // QUERY_TRACE_H
@@ -5,6 +5,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <limits>
 #include <stdint.h>
 
 class RankHeap
@@ -28,6 +29,16 @@ public:
 
     point_index top() const {return *m_begin;}
 
+    /**
+     * Candidates with a rank >= threshold() would be rejected by push().
+     */
+    point_index threshold() const {
+        if (!full()) {
+            return std::numeric_limits<point_index>::max();
+        }
+        return m_begin != m_end ? top() : std::numeric_limits<point_index>::min();
+    }
+
     void reset(size_t capacity) {
         m_data.resize(capacity);
         m_begin = std::begin(m_data);
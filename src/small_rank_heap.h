@@ -0,0 +1,133 @@
+#ifndef SMALL_RANK_HEAP_H
+#define SMALL_RANK_HEAP_H
+
+#include "point_search.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdint.h>
+
+/**
+ * Drop-in replacement for RankHeap when the capacity is at most 32.
+ *
+ * The ranks are kept in an sorted array that fits in 4 AVX registers. Unused
+ * slots hold INT32_MAX, so the last slot within the capacity is always the
+ * rank an candidate has to beat. An insert compares the candidate against all
+ * slots at once and merges it in with an shift and blend per register, there
+ * are no data dependent branches.
+ *
+ * Because every point in mipmap level L+1 has an higher rank than the points
+ * in level L, the items of previous levels stay in front of the array by
+ * themselves and sort() has nothing to do.
+ */
+class SmallRankHeap
+{
+public:
+    static const size_t max_capacity = 32;
+
+    typedef const point_index *const_iterator;
+
+    SmallRankHeap()
+    {
+        // m_slots[SENTINEL] sits right before the first rank, it makes
+        // threshold() of an empty capacity reject everything.
+        m_slots[SENTINEL] = std::numeric_limits<point_index>::min();
+        reset(0);
+    }
+
+    size_t size() const {return m_size;}
+
+    bool full() const {return m_size == m_capacity;}
+
+    point_index top() const {return data()[m_size - 1];}
+
+    /**
+     * Candidates with a rank >= threshold() would be rejected by push().
+     */
+    point_index threshold() const {return data()[(ptrdiff_t)m_capacity - 1];}
+
+    void reset(size_t capacity) {
+        // the cast copies max_capacity, binding it to std::min's reference
+        // would need an out of class definition.
+        m_capacity = std::min(capacity, (size_t)max_capacity);
+        m_size = 0;
+        std::fill(data(), data() + max_capacity + 1, std::numeric_limits<point_index>::max());
+    }
+
+    void push(point_index index) throw() {
+        if (index >= threshold()) {
+            return;
+        }
+        insert(index);
+        m_size = std::min(m_size + 1, m_capacity);
+    }
+
+    /**
+     * The array is always sorted, see the class comment.
+     */
+    void sort() {}
+
+    const_iterator begin() const {return data();}
+    const_iterator end() const {return data() + m_size;}
+
+    friend const_iterator begin(const SmallRankHeap &heap) {return heap.begin();}
+    friend const_iterator end(const SmallRankHeap &heap) {return heap.end();}
+
+private:
+    static const size_t SENTINEL = 7;
+
+    point_index *data() {return m_slots + SENTINEL + 1;}
+    const point_index *data() const {return m_slots + SENTINEL + 1;}
+
+    /**
+     * slot i becomes: the old slot i if it is smaller than index, index if
+     * the old slot i-1 is smaller, the old slot i-1 otherwise. The rank pushed
+     * out of the capacity, if any, is dropped.
+     */
+    void insert(point_index index) {
+#ifdef __AVX2__
+        // the shifted registers are built with permutes rather than unaligned
+        // loads, which would stall on the stores of the previous insert.
+        point_index *d = data();
+        const __m256i rotate = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+        const __m256i empty = _mm256_set1_epi32(std::numeric_limits<point_index>::max());
+        const __m256i last = _mm256_set1_epi32((point_index)m_capacity - 1);
+        __m256i slot = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i value = _mm256_set1_epi32(index);
+        __m256i carry = _mm256_set1_epi32(std::numeric_limits<point_index>::min());
+        for(size_t i = 0; i < max_capacity / 8; i++) {
+            __m256i current = _mm256_loadu_si256((const __m256i*)(d + i * 8));
+            __m256i rotated = _mm256_permutevar8x32_epi32(current, rotate);
+            __m256i previous = _mm256_blend_epi32(rotated, carry, 0x01);
+            __m256i keep = _mm256_cmpgt_epi32(value, current);
+            __m256i place = _mm256_cmpgt_epi32(value, previous);
+            __m256i merged = _mm256_blendv_epi8(_mm256_blendv_epi8(previous, value, place), current, keep);
+            // a scalar store here would stall the vector loads of the next insert.
+            __m256i dropped = _mm256_cmpgt_epi32(slot, last);
+            _mm256_storeu_si256((__m256i*)(d + i * 8), _mm256_blendv_epi8(merged, empty, dropped));
+            carry = rotated;
+            slot = _mm256_add_epi32(slot, _mm256_set1_epi32(8));
+        }
+#else
+        point_index *d = data();
+        size_t i = m_capacity;
+        for(; i > 0 && d[i - 1] > index; i--) {
+            d[i] = d[i - 1];
+        }
+        d[i] = index;
+        d[m_capacity] = std::numeric_limits<point_index>::max();
+#endif
+    }
+
+    // 8 slots in front of which the last is the sentinel, 32 ranks, one slot
+    // behind for the rank that is pushed out. The loads and stores are
+    // unaligned, an SmallRankHeap inside an Solution is allocated with new,
+    // which doesn't honour alignas(32) before C++17.
+    point_index m_slots[SENTINEL + 1 + max_capacity + 8];
+    size_t m_size;
+    size_t m_capacity;
+};
+
+#endif // SMALL_RANK_HEAP_H
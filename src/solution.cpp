@@ -10,6 +10,9 @@
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <chrono>
+
+#include <immintrin.h>
 
 
 #ifdef _MSC_VER
@@ -19,10 +22,45 @@
 // msvc is missing this compiler intrinsic. technically this instruction does not exist,
 // but it's convinient and may be added to the instruction set in the future.
 #define _mm256_extract_epi32(mm, i) _mm_extract_epi32(_mm256_extractf128_si256(mm, i >= 4), i % 4)
+
+#include <intrin.h>
+static inline int __builtin_ctz(unsigned x)
+{
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (int)index;
+}
 #endif
 
 const point_index AVX_COUNT = 1 << 11;
 
+// maximum error of the position models. The bounded search touches at most
+// 2 * MODEL_EPSILON + 1 floats, around 2 cache lines.
+const point_index MODEL_EPSILON = 16;
+
+// search_with_deadline() checks the clock after every DEADLINE_CHUNK points of an
+// strip, around 10us of scanning. Must be a multiple of bin_search::ZONE_SIZE.
+const point_index DEADLINE_CHUNK = 1 << 16;
+
+namespace {
+    // the Deadline of search() and search_mipmap(), folds away entirely.
+    struct no_deadline {
+        bool expired() const {return false;}
+    };
+
+    struct clock_deadline {
+        typedef std::chrono::steady_clock clock;
+
+        explicit clock_deadline(int64_t budget_ns)
+            :   end(clock::now() + std::chrono::nanoseconds(budget_ns))
+        {}
+
+        bool expired() const {return clock::now() >= end;}
+
+        clock::time_point end;
+    };
+}
+
 /**
  * Build an vector such that
  * result[lower_bound(from, value)    ] <= lower_bound(to, value)
@@ -67,8 +105,9 @@ std::vector<point_index> make_upper_cascading(const bin_search &from, const bin_
     return result;
 }
 
-Solution::Solution(const Point *points_begin, const Point *points_end)
+Solution::Solution(const Point *points_begin, const Point *points_end, level_index index)
     :   m_points(points_begin, points_end)
+    ,   m_index(index)
 {
     if (m_points.empty()) {
         return;
@@ -102,6 +141,14 @@ Solution::Solution(const Point *points_begin, const Point *points_end)
         first = pivot;
     }
 
+    if (m_index == model_index) {
+        for(size_t i = 0; i < m_x_mipmaps.size(); i++) {
+            m_x_mipmaps[i].build_model(MODEL_EPSILON);
+            m_y_mipmaps[i].build_model(MODEL_EPSILON);
+        }
+        return;
+    }
+
     // build cascading stuff. These accelate the binary searching. This works by creating
     // an mapping table that maps each index of mipmap n to an higher-level mipmap n+1.
     // since the mipmap level n+1 contains more and different elements than level n, we
@@ -134,6 +181,30 @@ point_index Solution::search(const Rect rect, const point_index count, Point *ou
     return avx_count + mipmap_count;
 }
 
+point_index Solution::search_with_deadline(const Rect rect, const point_index count, Point *out_points,
+                                           const int64_t budget_ns, search_status *status)
+{
+    const clock_deadline deadline(budget_ns);
+    status->exact = true;
+    status->complete_rank = (point_index)m_points.size();
+
+    if (count == 0 || m_points.size() == 0) {
+        return 0;
+    }
+
+    // the linear search is always done, it's shorter than an clock check or two.
+    point_index avx_count = search_linear(rect, count, out_points);
+    if (avx_count == count) {
+        return avx_count;
+    }
+
+    point_index complete_rank;
+    point_index mipmap_count = search_mipmap(rect, count - avx_count, out_points + avx_count, deadline, complete_rank);
+    status->exact = complete_rank == (point_index)m_points.size();
+    status->complete_rank = complete_rank;
+    return avx_count + mipmap_count;
+}
+
 point_index Solution::search_linear(const Rect rect, const point_index count, Point *out_points)
 {
     static_assert((AVX_COUNT % 8) == 0, "AVX_COUNT must be a multiple of 8 for this function");
@@ -170,24 +241,16 @@ point_index Solution::search_linear(const Rect rect, const point_index count, Po
     return (point_index)n;
 }
 
-void avx_search_single_bounds(const float* floats, const point_index* indices,
-                              const float low_float, const float high_float,
-                              const point_index count, RankHeap& heap)
+/**
+ * The vector loop of avx_search_single_bounds(). floats must be aligned to 32 bytes
+ * and count must be a multiple of 8.
+ */
+template<typename Heap>
+static inline void avx_search_aligned(const float* floats, const point_index* indices,
+                                      const __m256 low, const __m256 high,
+                                      const point_index count, Heap& heap)
 {
-    __m256 low = _mm256_broadcast_ss(&low_float);
-    __m256 high = _mm256_broadcast_ss(&high_float);
-
-    point_index i = 0;
-    // align
-    for(;(i < count) && ((uintptr_t)(floats+i) % sizeof(__m256)); i++)
-    {
-        if ((floats[i] >= low_float) && (floats[i] <= high_float)) {
-            heap.push(indices[i]);
-        }
-    }
-
-    const point_index sse_last = count - 7;
-    for(;i < sse_last; i+=8)
+    for(point_index i = 0; i < count; i+=8)
     {
         __m256 a = _mm256_load_ps(floats + i);
         __m256 low_in = _mm256_cmp_ps(low,  a, _CMP_LE_OQ);
@@ -195,6 +258,18 @@ void avx_search_single_bounds(const float* floats, const point_index* indices,
 
         if (__builtin_expect(!_mm256_testz_ps(low_in, high_in), 0))
         {
+#ifdef __AVX2__
+            // drop all candidates that can't beat the current top-k in one go,
+            // then only visit the lanes that are left.
+            __m256i threshold = _mm256_set1_epi32(heap.threshold());
+            __m256i ranks = _mm256_loadu_si256((const __m256i*)(indices + i));
+            __m256 better = _mm256_castsi256_ps(_mm256_cmpgt_epi32(threshold, ranks));
+            unsigned lanes = _mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(low_in, high_in), better));
+            while(lanes) {
+                heap.push(indices[i + __builtin_ctz(lanes)]);
+                lanes &= lanes - 1;
+            }
+#else
             __m256i mask = _mm256_castps_si256(_mm256_and_ps(low_in, high_in));
             if (_mm256_extract_epi32(mask, 0)) {heap.push(indices[i+0]);}
             if (_mm256_extract_epi32(mask, 1)) {heap.push(indices[i+1]);}
@@ -204,8 +279,31 @@ void avx_search_single_bounds(const float* floats, const point_index* indices,
             if (_mm256_extract_epi32(mask, 5)) {heap.push(indices[i+5]);}
             if (_mm256_extract_epi32(mask, 6)) {heap.push(indices[i+6]);}
             if (_mm256_extract_epi32(mask, 7)) {heap.push(indices[i+7]);}
+#endif
         }
     }
+}
+
+template<typename Heap>
+void avx_search_single_bounds(const float* floats, const point_index* indices,
+                              const float low_float, const float high_float,
+                              const point_index count, Heap& heap)
+{
+    __m256 low = _mm256_broadcast_ss(&low_float);
+    __m256 high = _mm256_broadcast_ss(&high_float);
+
+    point_index i = 0;
+    // align
+    for(;(i < count) && ((uintptr_t)(floats+i) % sizeof(__m256)); i++)
+    {
+        if ((floats[i] >= low_float) && (floats[i] <= high_float)) {
+            heap.push(indices[i]);
+        }
+    }
+
+    const point_index aligned_count = (count - i) & ~7;
+    avx_search_aligned(floats + i, indices + i, low, high, aligned_count, heap);
+    i += aligned_count;
 
     for(;i < count; i++)
     {
@@ -215,21 +313,129 @@ void avx_search_single_bounds(const float* floats, const point_index* indices,
     }
 }
 
+template void avx_search_single_bounds<RankHeap>(const float*, const point_index*, const float, const float,
+                                                 const point_index, RankHeap&);
+template void avx_search_single_bounds<SmallRankHeap>(const float*, const point_index*, const float, const float,
+                                                      const point_index, SmallRankHeap&);
+
+template<typename Heap>
+void search_strip(const bin_search &mipmap, const point_index first, const point_index last,
+                  const float low_float, const float high_float, Heap &heap)
+{
+    const point_index block = bin_search::ZONE_SIZE;
+    static_assert((bin_search::ZONE_SIZE % 8) == 0, "blocks must be a multiple of 8 for avx_search_aligned");
+
+    // the partial blocks at the start and end are scanned without looking at their zone.
+    const point_index blocks_first = std::min(last, (first + block - 1) / block * block);
+    const point_index blocks_last  = std::max(blocks_first, last / block * block);
+    avx_search_single_bounds(mipmap.other_values() + first, mipmap.indices() + first,
+                             low_float, high_float, blocks_first - first, heap);
+
+    __m256 low = _mm256_broadcast_ss(&low_float);
+    __m256 high = _mm256_broadcast_ss(&high_float);
+    const bin_search::zone *zone = mipmap.zones() + blocks_first / block;
+    for(point_index i = blocks_first; i < blocks_last; i += block, zone++) {
+        if (zone->max_other < low_float || zone->min_other > high_float) {
+            continue;
+        }
+        if (zone->min_rank >= heap.threshold()) {
+            continue;
+        }
+        avx_search_aligned(mipmap.other_values() + i, mipmap.indices() + i, low, high, block, heap);
+    }
+
+    avx_search_single_bounds(mipmap.other_values() + blocks_last, mipmap.indices() + blocks_last,
+                             low_float, high_float, last - blocks_last, heap);
+}
+
+template void search_strip<RankHeap>(const bin_search&, const point_index, const point_index,
+                                     const float, const float, RankHeap&);
+template void search_strip<SmallRankHeap>(const bin_search&, const point_index, const point_index,
+                                          const float, const float, SmallRankHeap&);
+
+/**
+ * search_strip() that stops when the deadline expires. Returns false if the
+ * strip wasn't searched completely.
+ */
+template<typename Heap>
+static inline bool search_strip(const bin_search &mipmap, const point_index first, const point_index last,
+                                const float low_float, const float high_float, Heap &heap, const no_deadline &)
+{
+    search_strip(mipmap, first, last, low_float, high_float, heap);
+    return true;
+}
+
+template<typename Heap>
+static bool search_strip(const bin_search &mipmap, const point_index first, const point_index last,
+                         const float low_float, const float high_float, Heap &heap, const clock_deadline &deadline)
+{
+    static_assert((DEADLINE_CHUNK % bin_search::ZONE_SIZE) == 0, "chunks must not split zones");
+
+    point_index begin = first;
+    while(begin < last) {
+        point_index end = std::min(last, (begin / DEADLINE_CHUNK + 1) * DEADLINE_CHUNK);
+        search_strip(mipmap, begin, end, low_float, high_float, heap);
+        begin = end;
+        if (begin < last && deadline.expired()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 point_index Solution::search_mipmap(const Rect &rect, point_index count, Point *out_points)
 {
-    m_heap.reset(count);
+    point_index complete_rank;
+    return search_mipmap(rect, count, out_points, no_deadline(), complete_rank);
+}
+
+template<typename Deadline>
+point_index Solution::search_mipmap(const Rect &rect, const point_index count, Point *out_points,
+                                    const Deadline &deadline, point_index &complete_rank)
+{
+    // max-heap used by the mipmaps. Counts up to SmallRankHeap::max_capacity,
+    // which includes the usual 20, use the register sized small_heap instead.
+    // Both are per thread, so several threads can search the same Solution.
+    static thread_local RankHeap heap;
+    static thread_local SmallRankHeap small_heap;
+
+    if ((size_t)count <= SmallRankHeap::max_capacity) {
+        return search_mipmap(rect, count, out_points, small_heap, deadline, complete_rank);
+    }
+    return search_mipmap(rect, count, out_points, heap, deadline, complete_rank);
+}
+
+template<typename Heap, typename Deadline>
+point_index Solution::search_mipmap(const Rect &rect, point_index count, Point *out_points,
+                                    Heap &heap, const Deadline &deadline, point_index &complete_rank)
+{
+    heap.reset(count);
 
     point_index x_low, x_high;
     point_index y_low, y_high;
 
-    size_t i;
-    for(i = 0; i < m_x_mipmaps.size(); i++)
+    // the lowest rank in level i
+    complete_rank = AVX_COUNT;
+    bool timed_out = false;
+
+    for(size_t i = 0; i < m_x_mipmaps.size(); i++)
     {
         bin_search &x_mipmap = m_x_mipmaps[i];
         bin_search &y_mipmap = m_y_mipmaps[i];
 
+        if (deadline.expired()) {
+            timed_out = true;
+            break;
+        }
+        if (m_index == model_index) {
+            x_low  = x_mipmap.model_lower_bound(rect.lx);
+            x_high = x_mipmap.model_upper_bound(rect.hx);
+
+            y_low  = y_mipmap.model_lower_bound(rect.ly);
+            y_high = y_mipmap.model_upper_bound(rect.hy);
+        }
         // the first level doesn't have cascading mapping tables.
-        if (i != 0) {
+        else if (i != 0) {
             x_low  = x_mipmap.lower_bound(rect.lx, m_x_lower_cascading[i-1][x_low ], m_x_lower_cascading[i-1][x_low  + 1]);
             x_high = x_mipmap.upper_bound(rect.hx, m_x_upper_cascading[i-1][x_high], m_x_upper_cascading[i-1][x_high + 1]);
 
@@ -248,34 +454,49 @@ point_index Solution::search_mipmap(const Rect &rect, point_index count, Point *
         auto x_size = x_high - x_low;
         auto y_size = y_high - y_low;
 
-        if (0 == x_size) continue;
-        if (0 == y_size) continue;
+        if (x_size <= 0 || y_size <= 0) {
+            complete_rank += (point_index)x_mipmap.size();
+            continue;
+        }
 
         if ((x_size) < (y_size))
         {
             bin_search &mipmap = x_mipmap;
             point_index first = x_low;
             point_index last  = x_high;
-            avx_search_single_bounds(mipmap.other_values() + first, mipmap.indices() + first,
-                                     rect.ly, rect.hy, last - first, m_heap);
+            if (!search_strip(mipmap, first, last, rect.ly, rect.hy, heap, deadline)) {
+                timed_out = true;
+                break;
+            }
         }
         else
         {
             bin_search &mipmap = y_mipmap;
             point_index first = y_low;
             point_index last  = y_high;
-            avx_search_single_bounds(mipmap.other_values() + first, mipmap.indices() + first,
-                                     rect.lx, rect.hx, last - first, m_heap);
+            if (!search_strip(mipmap, first, last, rect.lx, rect.hx, heap, deadline)) {
+                timed_out = true;
+                break;
+            }
         }
 
-        m_heap.sort();
-        if (m_heap.full()) {
+        heap.sort();
+        complete_rank += (point_index)x_mipmap.size();
+        if (heap.full()) {
             break;
         }
     }
 
-    for(point_index index : m_heap) {
+    // either all levels were searched, or the heap filled up at the end of an
+    // level. An strip that was cut short may still hold lower ranks than the
+    // heap, it's sorted by coordinate, not by rank.
+    if (!timed_out) {
+        complete_rank = (point_index)m_points.size();
+    }
+    heap.sort();
+
+    for(point_index index : heap) {
         *out_points++ = m_points[index];
     }
-    return (point_index)m_heap.size();
+    return (point_index)heap.size();
 }
@@ -5,13 +5,62 @@
 #include "aligned_allocator.h"
 #include "binary_search.h"
 #include "rank_heap.h"
+#include "small_rank_heap.h"
 
 #include <vector>
 #include <array>
+#include <stdint.h>
+
+/**
+ * Push the indices of all floats in [low_float, high_float] on the heap. This is the
+ * inner loop of search_mipmap(), floats and indices point into the same mipmap strip.
+ * Instantiated for RankHeap and SmallRankHeap.
+ */
+template<typename Heap>
+void avx_search_single_bounds(const float* floats, const point_index* indices,
+                              const float low_float, const float high_float,
+                              const point_index count, Heap& heap);
+
+/**
+ * avx_search_single_bounds() over the points [first, last) of an mipmap level. Blocks
+ * whose zone shows they hold no value in [low_float, high_float], or no rank that
+ * beats the heap, are skipped. Instantiated for RankHeap and SmallRankHeap.
+ */
+template<typename Heap>
+void search_strip(const bin_search &mipmap, const point_index first, const point_index last,
+                  const float low_float, const float high_float, Heap &heap);
+
+/**
+ * Build the mapping tables between two consecutive mipmap levels. See solution.cpp.
+ */
+std::vector<point_index> make_lower_cascading(const bin_search &from, const bin_search &to);
+std::vector<point_index> make_upper_cascading(const bin_search &from, const bin_search &to);
+
+/**
+ * Outcome of Solution::search_with_deadline().
+ */
+struct search_status {
+    // the result is the same as the result of search()
+    bool exact;
+    // every point inside the rect with a rank below complete_rank is in the
+    // result, unless the result already holds 'count' points with lower ranks.
+    point_index complete_rank;
+};
 
 class Solution {
 public:
-    Solution(const Point *points_begin, const Point *points_end);
+    /**
+     * How the bounds of the rect are found in each mipmap level.
+     */
+    enum level_index {
+        // binary search in the first level, the cascading tables narrow the
+        // binary searches in the levels after that.
+        cascading_index,
+        // an piecewise linear position model per level, see position_model.h
+        model_index
+    };
+
+    Solution(const Point *points_begin, const Point *points_end, level_index index = model_index);
 
     /**
      * run search_linear() for the first 1000-or-so points. If we haven't found
@@ -40,13 +89,33 @@ public:
      * start and end of the rect. We can then decide if we process the
      * X or Y mipmap for that level.
      *
-     * Finally, there exists an 'cascading' mapping table which speeds up
-     * the binary searches. This works by assuming the data of mipmap L+1
-     * is likely to be uniformly distrubuted along L.
+     * Finally, the binary searches are sped up by either an 'cascading' mapping
+     * table, which works by assuming the data of mipmap L+1 is likely to be
+     * uniformly distrubuted along L, or by an position model per level which
+     * predicts the bounds within a few elements.
      */
     point_index search_mipmap(const Rect &rect, const point_index count, Point *out_points);
 
+    /**
+     * search() that gives up after about 'budget_ns' nanoseconds. The mipmap levels
+     * are ordered by rank, so the points found before the budget runs out are the
+     * best points among the levels that were searched. The budget is checked
+     * between levels and every DEADLINE_CHUNK points of a strip.
+     */
+    point_index search_with_deadline(const Rect rect, const point_index count, Point *out_points,
+                                     const int64_t budget_ns, search_status *status);
+
 private:
+    // the points of a level are searched by rank, rank m_points.size() means
+    // all levels are done.
+    template<typename Heap, typename Deadline>
+    point_index search_mipmap(const Rect &rect, const point_index count, Point *out_points,
+                              Heap &heap, const Deadline &deadline, point_index &complete_rank);
+
+    template<typename Deadline>
+    point_index search_mipmap(const Rect &rect, const point_index count, Point *out_points,
+                              const Deadline &deadline, point_index &complete_rank);
+
     // an sorted vector of points. Sorted by rank.
     std::vector<Point> m_points;
 
@@ -58,15 +127,14 @@ private:
     std::vector<bin_search> m_x_mipmaps;
     std::vector<bin_search> m_y_mipmaps;
 
-    // data structures to speed up searching in the mipmaps
+    // data structures to speed up searching in the mipmaps. The cascading
+    // tables are only built for cascading_index.
+    level_index m_index;
     std::vector<std::vector<point_index>> m_x_lower_cascading;
     std::vector<std::vector<point_index>> m_x_upper_cascading;
 
     std::vector<std::vector<point_index>> m_y_lower_cascading;
     std::vector<std::vector<point_index>> m_y_upper_cascading;
-
-    // max-heap used by the mipmaps.
-    RankHeap m_heap;
 };
 
 
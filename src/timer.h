@@ -5,6 +5,12 @@
 
 #include <atomic>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
 struct rdtsc_timer {
     rdtsc_timer()
         :   first(__rdtsc())
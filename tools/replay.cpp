@@ -0,0 +1,250 @@
+/**
+ * Replay a trace recorded with CHURCHILL_TRACE against one or two builds of the
+ * library and compare their latency distributions.
+ *
+ * usage: churchill_replay --trace FILE [--points FILE] [--speed recorded|max] [--runs N] LIB [LIB]
+ *
+ * Each library gets its own context over the same points. Runs alternate between the
+ * libraries so both see the same machine state. The result counts are checked against
+ * the recording, and the results of the second library against the first.
+ *
+ * Searches recorded from search_with_deadline() are replayed with the same budget.
+ * Their results depend on the timing, so they are left out of both result checks.
+ *
+ * The records are replayed on one thread, in the order the searches started. A trace of
+ * several search threads is replayed serially: --speed recorded reproduces when the
+ * searches arrived, but not that they overlapped.
+ *
+ * Exits with 2 if the results of a and b differ, 3 if an result count differs from the
+ * recording, which usually means the points file doesn't belong to the trace.
+ */
+
+#include "point_search.h"
+#include "dll.h"
+#include "query_trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock clock;
+
+struct library {
+    std::string path;
+    T_create create;
+    T_search search;
+    T_destroy destroy;
+    T_search_with_deadline search_with_deadline;   // optional
+    SearchContext *context;
+    std::vector<double> latencies_ns;
+    std::vector<point_index> results;   // ranks returned per query, from the first run.
+    size_t mismatches;                  // result counts that differ from the recording.
+};
+
+template<typename F>
+F lookup(void *handle, const char *name) {
+#ifdef _WIN32
+    return (F)GetProcAddress((HMODULE)handle, name);
+#else
+    return (F)dlsym(handle, name);
+#endif
+}
+
+bool load(library &lib) {
+#ifdef _WIN32
+    void *handle = (void*)LoadLibraryA(lib.path.c_str());
+#else
+    void *handle = dlopen(lib.path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (!handle) {
+        return false;
+    }
+    lib.create = lookup<T_create>(handle, "create");
+    lib.search = lookup<T_search>(handle, "search");
+    lib.destroy = lookup<T_destroy>(handle, "destroy");
+    lib.search_with_deadline = lookup<T_search_with_deadline>(handle, "search_with_deadline");
+    return lib.create && lib.search && lib.destroy;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[i];
+}
+
+void replay(library &lib, const std::vector<TraceRecord> &records, bool recorded_speed, bool keep_results)
+{
+    std::vector<Point> out;
+    auto epoch = clock::now();
+    for(const TraceRecord &r : records) {
+        if (recorded_speed) {
+            std::this_thread::sleep_until(epoch + std::chrono::nanoseconds(r.start_ns));
+        }
+        out.resize(std::max(r.count, 0));
+
+        const bool deadline = r.budget_ns >= 0;
+        SearchStatus status;
+        auto start = clock::now();
+        point_index n = deadline ? lib.search_with_deadline(lib.context, r.rect, r.count, out.data(), r.budget_ns, &status)
+                                 : lib.search(lib.context, r.rect, r.count, out.data());
+        auto stop = clock::now();
+        lib.latencies_ns.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+
+        if (keep_results && !deadline) {
+            lib.mismatches += n != r.result;
+            lib.results.push_back(n);
+            for(point_index i = 0; i < n; i++) {
+                lib.results.push_back(out[i].rank);
+            }
+        }
+    }
+}
+
+void print_row(const std::string &name, std::vector<double> latencies) {
+    std::sort(begin(latencies), end(latencies));
+    double sum = 0;
+    for(double l : latencies) {
+        sum += l;
+    }
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << (latencies.empty() ? 0 : sum / latencies.size())
+              << std::setw(10) << percentile(latencies, 0.5)
+              << std::setw(10) << percentile(latencies, 0.9)
+              << std::setw(10) << percentile(latencies, 0.99)
+              << std::setw(10) << percentile(latencies, 0.999)
+              << std::setw(10) << (latencies.empty() ? 0 : latencies.back()) << std::endl;
+}
+
+void usage(const char *argv0) {
+    std::cerr << "usage: " << argv0 << " --trace FILE [--points FILE] [--speed recorded|max] [--runs N] LIB [LIB]" << std::endl;
+    exit(1);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    std::string trace_path, points_path;
+    bool recorded_speed = false;
+    int runs = 1;
+    std::vector<library> libs;
+
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (!strcmp(arg, "--trace") && has_value) {
+            trace_path = argv[++i];
+        } else if (!strcmp(arg, "--points") && has_value) {
+            points_path = argv[++i];
+        } else if (!strcmp(arg, "--speed") && has_value) {
+            std::string speed = argv[++i];
+            if (speed != "recorded" && speed != "max") {
+                usage(argv[0]);
+            }
+            recorded_speed = speed == "recorded";
+        } else if (!strcmp(arg, "--runs") && has_value) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (arg[0] != '-' && libs.size() < 2) {
+            library lib = library();
+            lib.path = arg;
+            libs.push_back(lib);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (trace_path.empty() || libs.empty()) {
+        usage(argv[0]);
+    }
+    if (points_path.empty()) {
+        points_path = trace_path + ".points";
+    }
+
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    if (!trace::read(trace_path, header, records)) {
+        std::cerr << "can not read trace " << trace_path << std::endl;
+        return 1;
+    }
+    // records are written when an search ends, searches of other threads may
+    // have started earlier.
+    std::stable_sort(begin(records), end(records), [](const TraceRecord &a, const TraceRecord &b) {
+        return a.start_ns < b.start_ns;
+    });
+    std::vector<Point> points;
+    if (!trace::read_points(points_path, points)) {
+        std::cerr << "can not read points " << points_path << std::endl;
+        return 1;
+    }
+    size_t deadlines = 0;
+    for(const TraceRecord &r : records) {
+        deadlines += r.budget_ns >= 0;
+    }
+    std::cout << records.size() << " queries (" << deadlines << " with a deadline, " << header.dropped
+              << " dropped while recording), " << points.size() << " points" << std::endl;
+
+    for(library &lib : libs) {
+        if (!load(lib)) {
+            std::cerr << "can not load " << lib.path << std::endl;
+            return 1;
+        }
+        if (deadlines != 0 && !lib.search_with_deadline) {
+            std::cerr << lib.path << " does not export search_with_deadline" << std::endl;
+            return 1;
+        }
+        lib.context = lib.create(points.data(), points.data() + points.size());
+    }
+
+    for(int run = 0; run < runs; run++) {
+        for(library &lib : libs) {
+            replay(lib, records, recorded_speed, run == 0);
+        }
+    }
+
+    std::cout << std::left << std::setw(12) << "ns" << std::right
+              << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+              << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+    std::vector<double> recorded;
+    for(const TraceRecord &r : records) {
+        recorded.push_back((double)r.duration_ns);
+    }
+    print_row("recorded", recorded);
+    for(size_t i = 0; i < libs.size(); i++) {
+        print_row(i == 0 ? "a" : "b", libs[i].latencies_ns);
+    }
+    for(size_t i = 0; i < libs.size(); i++) {
+        std::cout << (i == 0 ? "a: " : "b: ") << libs[i].path << std::endl;
+    }
+
+    int status = 0;
+    for(size_t i = 0; i < libs.size(); i++) {
+        if (libs[i].mismatches != 0) {
+            std::cout << (i == 0 ? "a: " : "b: ") << libs[i].mismatches << " result counts differ from the recording" << std::endl;
+            status = 3;
+        }
+    }
+    if (libs.size() == 2 && libs[0].results != libs[1].results) {
+        std::cout << "results differ between a and b" << std::endl;
+        status = 2;
+    }
+
+    for(library &lib : libs) {
+        lib.destroy(lib.context);
+    }
+    return status;
+}